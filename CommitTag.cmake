@@ -0,0 +1,25 @@
+# CommitTag.cmake -- Compile the project's Git commit into DetermineCommitTag.
+#
+# In the CMakeLists.txt of a program using supportfunctions.cpp:
+#     include(path/to/QtSupportRoutines/CommitTag.cmake)
+#     add_commit_tag(<target>)
+#
+# committag.h is regenerated in the build directory before every build and
+# only changes when the commit does.  SOURCE_DIR is still defined so that a
+# build without git or ArchiveTag.txt can look at run time.
+
+set(COMMIT_TAG_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/committag.sh)
+
+function(add_commit_tag target)
+    set(header ${CMAKE_CURRENT_BINARY_DIR}/committag.h)
+    add_custom_target(${target}_commit_tag
+        COMMAND sh ${COMMIT_TAG_SCRIPT} ${CMAKE_CURRENT_SOURCE_DIR} ${header}
+        BYPRODUCTS ${header}
+        COMMENT "Checking commit tag for ${target}"
+        VERBATIM)
+    add_dependencies(${target} ${target}_commit_tag)
+    target_include_directories(${target} PRIVATE ${CMAKE_CURRENT_BINARY_DIR})
+    target_compile_definitions(${target} PRIVATE
+        HAVE_COMMITTAG_H
+        SOURCE_DIR="${CMAKE_CURRENT_SOURCE_DIR}")
+endfunction()
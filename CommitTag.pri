@@ -0,0 +1,27 @@
+# CommitTag.pri -- Compile the project's Git commit into DetermineCommitTag.
+#
+# In the .pro file of a program using supportfunctions.cpp:
+#     include(path/to/QtSupportRoutines/CommitTag.pri)
+#
+# committag.h is regenerated in the build directory before every build and
+# only changes when the commit does.  SOURCE_DIR is still defined so that a
+# build without git or ArchiveTag.txt can look at run time.
+#
+# The header is the output of an extra compiler, so qmake knows that objects
+# including it depend on it even before it exists: they are compiled after it
+# is written (also under make -j) and again whenever the commit changes.
+
+COMMIT_TAG_HEADER = $$OUT_PWD/committag.h
+COMMIT_TAG_SCRIPT = $$PWD/committag.sh
+
+commit_tag.name = Checking commit tag
+commit_tag.input = COMMIT_TAG_SCRIPT
+commit_tag.output = $$COMMIT_TAG_HEADER
+commit_tag.commands = sh ${QMAKE_FILE_IN} $$shell_quote($$_PRO_FILE_PWD_) ${QMAKE_FILE_OUT}
+commit_tag.depends = FORCE      # Run every build; the script leaves an unchanged header alone.
+commit_tag.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += commit_tag
+
+INCLUDEPATH += $$OUT_PWD
+DEFINES += HAVE_COMMITTAG_H
+DEFINES += SOURCE_DIR=\'\"$$_PRO_FILE_PWD_\"\'
@@ -0,0 +1,32 @@
+#!/bin/sh
+# committag.sh -- Write a header holding the Git commit of a source tree.
+#
+#   sh committag.sh SOURCE_DIR OUTPUT_HEADER
+#
+# Used by CommitTag.pri and CommitTag.cmake on every build.  The header is only
+# rewritten when the tag changes, so an unchanged commit rebuilds nothing.
+# Falls back to ArchiveTag.txt (for source trees exported without .git), then
+# to "NotSet", in which case DetermineCommitTag tries SOURCE_DIR at run time.
+
+src=$1
+out=$2
+
+tag=$(git -C "$src" log -1 --format=%H 2>/dev/null)
+if [ -z "$tag" ] && [ -f "$src/ArchiveTag.txt" ]; then
+    tag=$(head -n 1 "$src/ArchiveTag.txt")
+fi
+[ -n "$tag" ] || tag=NotSet
+
+tmp="$out.tmp"
+{
+    echo "/* Generated by committag.sh from $src; do not edit. */"
+    echo "#ifndef COMMITTAG_H"
+    echo "#define COMMITTAG_H"
+    echo "static constexpr char BuildCommitTag[] = \"$tag\";"
+    echo "#endif // COMMITTAG_H"
+} > "$tmp"
+if cmp -s "$tmp" "$out"; then
+    rm -f "$tmp"
+else
+    mv -f "$tmp" "$out"
+fi
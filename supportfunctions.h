@@ -25,27 +25,327 @@
 #include <QCoreApplication>
 #include <QtCore/QCoreApplication>
 #include <QtSql>
+#include <QFuture>
+
+/*!
+ * \brief The DebugBufferFullPolicy enum -- What saveMessageOutput does when the capture buffer is full.
+ */
+enum DebugBufferFullPolicy
+{
+    DropNewest,         //!< Discard the message being captured and count it as dropped.
+    BlockUntilFlushed,  //!< Flush the buffer (or wait for another thread to flush it), then capture.
+    OverwriteOldest     //!< Discard the oldest captured message to make room.
+};
+
+/*!
+ * \brief The DiagnosticsSite class -- One diagnostic statement's cached answer to DiagnosticsEnabled.
+ *
+ * Used by the diagDebug() family of macros; checking an unchanged site costs
+ * two atomic loads and a compare.
+ */
+class DiagnosticsSite
+{
+public:
+    DiagnosticsSite(QtMsgType type, const char *file, const char *function)
+        : siteType(type), siteFile(file), siteFunction(function) {}
+    inline bool enabled();
+
+private:
+    bool refresh();
+    QtMsgType siteType;
+    const char *siteFile;
+    const char *siteFunction;
+    QAtomicInt cached;      //!< Filter generation * 2 + enabled; 0 before the first check.
+};
+
+/*!
+ * \brief The DiagnosticsEntry struct -- One message as bothMessageOutput gives it to each sink.
+ */
+struct DiagnosticsEntry
+{
+    DiagnosticsEntry(qint64 msecs, QtMsgType msgType, const char *file, const char *func, int lineNo, const QString &msg)
+        : time(msecs), type(msgType), fileName(file), function(func), line(lineNo), message(msg) {}
+    const QByteArray &text() const;     //!< Terminal line, newline included; formatted once for all sinks.
+
+    qint64 time;                //!< Milliseconds since the epoch.
+    QtMsgType type;
+    const char *fileName;       //!< Source file name without its directory.
+    const char *function;       //!< Function name without class, arguments or return type.
+    int line;
+    const QString &message;
+
+private:
+    mutable QByteArray formatted;
+};
+
+/*!
+ * \brief The DiagnosticsSink class -- Somewhere else for bothMessageOutput to send messages.
+ */
+class DiagnosticsSink
+{
+public:
+    virtual ~DiagnosticsSink() {}
+    virtual void write(const DiagnosticsEntry &entry) = 0;  //!< Called on the thread that logged the message.
+    virtual void flush() {}                                 //!< Write out anything held back.
+};
+
+/*!
+ * \brief The DiagnosticsFields class -- Key/value fields for the messages this thread logs while it exists.
+ *
+ *     DiagnosticsFields fields("device", deviceId, "state", "idle");
+ *     qWarning() << "No reply";       // Stored with Fields {"device":7,"state":"idle"}
+ *
+ * Values are kept in binary form and only turned into JSON when written out,
+ * to the DebugInfo Fields column.  Scopes nest; an inner key replaces an outer.
+ * See IndexDiagnosticsField for searching by a field.
+ */
+class DiagnosticsFields
+{
+public:
+    template <typename... KeyValues>
+    explicit DiagnosticsFields(const KeyValues &... keyValues) : mark(pendingSize()) { add(keyValues...); }
+    ~DiagnosticsFields() { truncatePending(mark); }
+
+private:
+    Q_DISABLE_COPY(DiagnosticsFields)
+    static int pendingSize();
+    static void truncatePending(int size);
+    static void addInteger(const char *key, qint64 value);
+    static void addDouble(const char *key, double value);
+    static void addBool(const char *key, bool value);
+    static void addString(const char *key, const QString &value);
+    static void addValue(const char *key, bool value) { addBool(key, value); }
+    static void addValue(const char *key, int value) { addInteger(key, value); }
+    static void addValue(const char *key, unsigned value) { addInteger(key, qint64(value)); }
+    static void addValue(const char *key, long value) { addInteger(key, qint64(value)); }
+    static void addValue(const char *key, unsigned long value) { addInteger(key, qint64(value)); }
+    static void addValue(const char *key, long long value) { addInteger(key, qint64(value)); }
+    static void addValue(const char *key, unsigned long long value) { addInteger(key, qint64(value)); }
+    static void addValue(const char *key, float value) { addDouble(key, double(value)); }
+    static void addValue(const char *key, double value) { addDouble(key, value); }
+    static void addValue(const char *key, const char *value) { addString(key, QString::fromUtf8(value)); }
+    static void addValue(const char *key, const QString &value) { addString(key, value); }
+    static void addValue(const char *key, const QByteArray &value) { addString(key, QString::fromUtf8(value)); }
+    void add() {}
+    template <typename Value, typename... Rest>
+    void add(const char *key, const Value &value, const Rest &... rest) { addValue(key, value); add(rest...); }
+    int mark;       //!< Size of the thread's fields before this scope's.
+};
+
+/*!
+ * \brief The DiagnosticsSinkId enum -- The sinks built in to bothMessageOutput.
+ */
+enum DiagnosticsSinkId
+{
+    TerminalSink,       //!< \a stderr, through the terminal writer.
+    DatabaseSink,       //!< The DebugInfo table, through the capture buffer (and spool, if enabled).
+    MemorySink          //!< The last DiagnosticsMemoryCapacity messages, for RecentDiagnostics.
+};
+
+/*!
+ * \brief The DiagnosticsQuery struct -- Which DebugInfo rows a DiagnosticsCursor reads.
+ *
+ * Members left empty do not restrict.  The time range and severities use the
+ * table's indexes; the substring tests only look at the rows those leave.
+ */
+struct DiagnosticsQuery
+{
+    QDateTime from;             //!< Earliest Time, inclusive.
+    QDateTime to;               //!< Latest Time, exclusive.
+    QStringList severities;     //!< "Debug", "Info", "Warning", "Critical", "Fatal".
+    QString archiveTag;         //!< Exact ArchiveTag.
+    QString file;               //!< Text in FilePath.
+    QString function;           //!< Text in FunctionName.
+    QString message;            //!< Text in Message.
+    QVariantMap fields;         //!< Field values; see IndexDiagnosticsField.  Unindexed fields: MySQL only.
+    int pageSize = 1000;        //!< Rows read from the server at a time.
+    bool newestFirst = false;
+};
+
+/*!
+ * \brief The DiagnosticsRow struct -- One DebugInfo row read by a DiagnosticsCursor.
+ */
+struct DiagnosticsRow
+{
+    qint64 id = -1;
+    QDateTime time;
+    QString severity;
+    QString archiveTag;
+    QString filePath;
+    QString functionName;
+    int line = 0;
+    QString message;
+    int repeatCount = 1;
+    QDateTime lastTime;
+    QString fields;             //!< JSON; empty if the row has none.
+};
+
+/*!
+ * \brief The DiagnosticsCursor class -- Reads the rows of a DiagnosticsQuery a page at a time.
+ *
+ *     DiagnosticsCursor cursor(query);
+ *     while (cursor.next())
+ *         use(cursor.row());
+ *
+ * Pages are fetched by keyset, after the last row read, so reading stays
+ * cheap however far into the result it goes.
+ */
+class DiagnosticsCursor
+{
+public:
+    explicit DiagnosticsCursor(const DiagnosticsQuery &query, const QString &connectionName = QString());
+    bool next();
+    const DiagnosticsRow &row() const { return current; }
+    QSqlError lastError() const { return error; }
+
+private:
+    Q_DISABLE_COPY(DiagnosticsCursor)
+    bool fetchPage();
+    DiagnosticsQuery filter;
+    QSqlDatabase db;
+    QString sql;                //!< The query, with %1 for the keyset condition.
+    QVariantList bindings;      //!< Values for the query's predicates, in order.
+    QSqlQuery page;
+    int rowsInPage;
+    bool more;
+    QString lastTime;           //!< Time of the current row, as bound for the next page.
+    DiagnosticsRow current;
+    QSqlError error;
+};
+
+enum { DiagnosticsHistogramBuckets = 24 };
+
+/*!
+ * \brief The DiagnosticsMetrics struct -- What the diagnostics pipeline has cost so far.
+ *
+ * Histogram bucket i counts samples from 2^i up to 2^(i+1); bucket 0 includes 0.
+ */
+struct DiagnosticsMetrics
+{
+    quint64 captured[5];        //!< Messages captured: Debug, Info, Warning, Critical, Fatal.
+    quint64 capturedBytes;      //!< UTF-8 message bytes put in the capture buffers.
+    quint64 buffered;           //!< Messages waiting in the capture buffer now.
+    quint64 filtered;           //!< Messages the filters rejected.
+    quint64 coalesced;          //!< Repeats counted instead of saved.
+    quint64 rateSuppressed;     //!< Messages over a rate limit.
+    quint64 dropped;            //!< Messages lost because the capture buffer was full.
+    quint64 terminalDropped;    //!< Terminal lines lost because stderr could not keep up.
+    quint64 flushes;            //!< Dumps to the database, local store or terminal.
+    quint64 flushMicros;        //!< Total time spent in them.
+    quint64 rowsInserted;       //!< DebugInfo rows committed.
+    quint64 insertErrors;       //!< Failed prepares, inserts and commits.
+    quint64 captureNanos;       //!< Total time spent in saveMessageOutput.
+    quint64 queries;            //!< ShowDiagnosticsSince and ShowDiagnosticsAfterId queries.
+    quint64 queryMicros;        //!< Total time spent running and printing them.
+    quint64 queryRows;          //!< Rows they printed.
+    quint64 flushHistogram[DiagnosticsHistogramBuckets];    //!< Dump times in microseconds.
+    quint64 captureHistogram[DiagnosticsHistogramBuckets];  //!< saveMessageOutput times in nanoseconds.
+};
 
 /******    Global data declarations   *********/
 extern QDateTime StartTime;
 extern bool ShowDiagnostics, ImmediateDiagnostics, DontActuallyWriteDatabase;
 extern QString ConnectionName, CommitTag, DebugConnectionName;
+extern int DebugInfoCapacity, DebugInfoFlushThreshold, DebugInfoFlushIntervalMs, DebugInfoInsertBatchSize;
+extern int DebugInfoRetentionDays, DebugInfoPurgeIntervalMinutes;
+extern DebugBufferFullPolicy DebugInfoFullPolicy;
+extern bool AsyncDiagnosticsFlush, DebugInfoPartitioned;
+extern bool FlightRecorderMode;
+extern int FlightRecorderBefore, FlightRecorderAfter;
+extern int DiagnosticsRepeatWindowMs, DiagnosticsMetricsIntervalMs;
+extern int DiagnosticsMemoryCapacity;
+extern QString DiagnosticsFilePath;
+extern int DiagnosticsFileCompression;
+extern int ConnectionPoolMax, ConnectionPoolIdleSeconds, ConnectionPoolMin, ConnectionPoolWaitMs;
+extern int TerminalBufferSize, TerminalFlushIntervalMs;
+extern bool TerminalWriterThread;
+extern QAtomicInt DiagnosticsFilterGeneration;
 
 /*********  Global function declarations  ***************/
 void DetermineCommitTag();
+quint64 DebugInfoDroppedCount();
+quint64 TerminalDroppedCount();
+DiagnosticsMetrics DiagnosticsMetricsSnapshot();
+QByteArray DiagnosticsMetricsJson();
+void FlushTerminalOutput();
+bool DiagnosticsEnabled(QtMsgType type, const char *file, const char *function);
+void SetDiagnosticsMinimumSeverity(QtMsgType minimum);
+void SetDiagnosticsFileSeverity(const QString &file, QtMsgType minimum);
+void SetDiagnosticsFunctionSeverity(const QString &function, QtMsgType minimum);
+void ClearDiagnosticsFilters();
+void SetDiagnosticsRateLimit(QtMsgType type, int perSecond, int burst = 0);
 
 void saveMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg);
 void terminalMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg);
 void bothMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+void SetDiagnosticsSinkSeverity(DiagnosticsSinkId sink, QtMsgType minimum);
+void AddDiagnosticsSink(DiagnosticsSink *sink, QtMsgType minimum = QtDebugMsg);
+void RemoveDiagnosticsSink(DiagnosticsSink *sink);
+void FlushDiagnosticsSinks();
+QStringList RecentDiagnostics();
 QDateTime ShowDiagnosticsSince(const QDateTime startTime);
+qint64 ShowDiagnosticsAfterId(qint64 lastId);
+qint64 ShowDiagnosticsMatching(const DiagnosticsQuery &query);
 void FlushDiagnostics();
 void DumpDebugInfo();
+bool StartDiagnosticsFlushWorker();
+void StopDiagnosticsFlushWorker();
+void PurgeDebugInfo(QSqlDatabase &dbConn);
+bool EnableDiagnosticsSpool(const QString &path, qint64 sizeBytes = 8 * 1024 * 1024);
+bool EnableDiagnosticsStoreAndForward(const QString &path, qint64 maxBytes = 64 * 1024 * 1024);
+qint64 PrintDiagnosticsFile(const QString &path);
+qint64 ImportDiagnosticsFile(const QString &path, QSqlDatabase &dbConn);
+bool UseDiagnosticsCollector(const QString &socketPath);
+bool StartDiagnosticsCollector(const QString &socketPath);
+void StopDiagnosticsCollector();
 
 void addConnectionFromString(const QString &arg, bool DebugConnection = false);
 QSqlError addConnection(const QString &driver, const QString &dbName, const QString &host,
                         const QString &user, const QString &passwd, int port, QString connName = "");
 QSqlError addDebugConnection(const QString &driver, const QString &dbName, const QString &host,
                         const QString &user, const QString &passwd, int port, QString connName = "");
+QFuture<QSqlError> addConnectionFromStringAsync(const QString &arg, bool DebugConnection = false);
+QFuture<QSqlError> addConnectionAsync(const QString &driver, const QString &dbName, const QString &host,
+                                      const QString &user, const QString &passwd, int port, QString connName = "");
+QFuture<QSqlError> addDebugConnectionAsync(const QString &driver, const QString &dbName, const QString &host,
+                                           const QString &user, const QString &passwd, int port, QString connName = "");
+QSqlDatabase DatabaseForThread();
+void ReleaseDatabaseForThread();
+void SetConnectionPoolTimeZone(const QTimeZone &zone);
 QString setDbTimeZoneSQL(QTimeZone &theZone, QDateTime atTime);
+bool IndexDiagnosticsField(const QString &key, const QString &sqlType = "varchar(64)");
+
+bool DiagnosticsSite::enabled()
+{
+    const int state = cached.loadRelaxed();
+    if (state >> 1 == DiagnosticsFilterGeneration.loadRelaxed())
+        return state & 1;
+    return refresh();
+}
+
+/*!
+ * Filtered logging: diagDebug() << ... or diagDebug("format", ...), and likewise
+ * diagInfo, diagWarning and diagCritical.  The message is only built if the
+ * filters keep it, so a disabled statement costs a branch.  Defining
+ * DIAGNOSTICS_NO_DEBUG (or QT_NO_DEBUG_OUTPUT) compiles diagDebug out entirely.
+ */
+#define DIAG_SITE_ENABLED(type) \
+    ([](const char *diagFile_, const char *diagFunction_) { \
+        static DiagnosticsSite diagSite_(type, diagFile_, diagFunction_); \
+        return diagSite_.enabled(); \
+    }(QT_MESSAGELOG_FILE, QT_MESSAGELOG_FUNC))
+
+#define DIAG_LOGGER(type) \
+    for (bool diagOn_ = DIAG_SITE_ENABLED(type); diagOn_; diagOn_ = false) \
+        QMessageLogger(QT_MESSAGELOG_FILE, QT_MESSAGELOG_LINE, QT_MESSAGELOG_FUNC)
+
+#if defined(DIAGNOSTICS_NO_DEBUG) || defined(QT_NO_DEBUG_OUTPUT)
+#define diagDebug(...) while (false) QMessageLogger().noDebug(__VA_ARGS__)
+#else
+#define diagDebug(...) DIAG_LOGGER(QtDebugMsg).debug(__VA_ARGS__)
+#endif
+#define diagInfo(...) DIAG_LOGGER(QtInfoMsg).info(__VA_ARGS__)
+#define diagWarning(...) DIAG_LOGGER(QtWarningMsg).warning(__VA_ARGS__)
+#define diagCritical(...) DIAG_LOGGER(QtCriticalMsg).critical(__VA_ARGS__)
 
 #endif // SUPPORTFUNCTIONS_H
@@ -0,0 +1,12 @@
+# diagbench.pro -- Measure what the diagnostics pipeline costs.
+
+QT = core sql
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = diagbench
+
+INCLUDEPATH += ../..
+HEADERS += ../../supportfunctions.h
+SOURCES += main.cpp ../../supportfunctions.cpp
+
+include(../../CommitTag.pri)
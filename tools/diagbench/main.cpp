@@ -0,0 +1,342 @@
+/*!
+\file main.cpp
+\brief diagbench -- Measure the cost of capturing, dumping and showing diagnostics.
+\author Thomas A. DeMay
+\date 2015
+\par    Copyright (C) 2015  Thomas A. DeMay
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    Results go to stdout as JSON, one object per line: a "capture" row for
+    each message handler and thread count, a "show" row for each table
+    size, and last a "metrics" row holding DiagnosticsMetricsJson.  What
+    terminalMessageOutput, bothMessageOutput and ShowDiagnosticsSince print
+    goes to stderr as usual; redirect it to keep it out of the way.
+ */
+#include "supportfunctions.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <atomic>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+/***********  Allocation counting   *************/
+
+static std::atomic<quint64> Allocations(0);     //!< Heap allocations made by any thread.
+
+#if defined(__GLIBC__)
+/* Qt containers allocate with malloc rather than operator new, so count at
+   malloc, which operator new also uses; glibc exports the real allocator. */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+extern "C" void *malloc(size_t size) noexcept
+{
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) noexcept
+{
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) noexcept
+{
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+#else
+/* Elsewhere only operator new is counted, so Qt's own buffers are missed. */
+void *operator new(size_t size)
+{
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
+/***********  Measurements   *************/
+
+/*!
+ * \brief createDebugInfoTable -- A DebugInfo table in SQLite's dialect, made before addDebugConnection.
+ *
+ * The table addDebugConnection creates is MySQL's; this one has the same
+ * columns and the Time index, so the library's inserts and queries run unchanged.
+ */
+static bool createDebugInfoTable(const QString &path)
+{
+    bool ok;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "diagbench_setup");
+        db.setDatabaseName(path);
+        QSqlQuery query(db);
+        ok = db.open()
+                && query.exec("CREATE TABLE DebugInfo (idDebugInfo INTEGER PRIMARY KEY AUTOINCREMENT,"
+                              " Time TEXT, Severity TEXT, ArchiveTag TEXT, FilePath TEXT, FunctionName TEXT,"
+                              " SourceLineNo INTEGER, Message TEXT, RepeatCount INTEGER NOT NULL DEFAULT 1,"
+                              " LastTime TEXT, Fields TEXT)")
+                && query.exec("CREATE INDEX DebugInfoTime ON DebugInfo (Time)")
+                && query.exec("CREATE INDEX DebugInfoSeverityTime ON DebugInfo (Severity, Time)");
+        if (!ok)
+            fprintf(stderr, "Unable to create DebugInfo in %s: %s\n", qPrintable(path), qPrintable(query.lastError().text()));
+    }
+    QSqlDatabase::removeDatabase("diagbench_setup");
+    return ok;
+}
+
+/*!
+ * \brief captureMessages -- Log \a messages through \a handler from \a threads threads at once.
+ *
+ * Messages are built beforehand and differ from each other, so neither
+ * formatting nor coalescing is part of what is measured.
+ * \param allocations   Set to the heap allocations made while capturing, if not null.
+ * \return Nanoseconds from the start of the first thread to the end of the last.
+ */
+static qint64 captureMessages(QtMessageHandler handler, int messages, int threads, quint64 *allocations = nullptr)
+{
+    QVector<QString> texts;
+    texts.reserve(messages);
+    for (int i = 0; i < messages; ++i)
+        texts.append(QString("Benchmark message %1 of %2, value %3").arg(i).arg(messages).arg(i * 7919 % 10007));
+    std::atomic<bool> go(false);
+    QVector<QThread *> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        const int first = int(qint64(messages) * t / threads), last = int(qint64(messages) * (t + 1) / threads);
+        workers.append(QThread::create([handler, &texts, &go, first, last]() {
+            const QMessageLogContext context(__FILE__, __LINE__, Q_FUNC_INFO, "default");
+            while (!go.load(std::memory_order_acquire))
+                QThread::yieldCurrentThread();
+            for (int i = first; i < last; ++i)
+                handler(QtDebugMsg, context, texts.at(i));
+        }));
+        workers.last()->start();
+    }
+    QElapsedTimer timer;
+    const quint64 allocationsBefore = Allocations.load();
+    timer.start();
+    go.store(true, std::memory_order_release);
+    for (QThread *worker : workers)
+        worker->wait();
+    const qint64 nanos = timer.nsecsElapsed();
+    if (allocations)
+        *allocations = Allocations.load() - allocationsBefore;
+    qDeleteAll(workers);
+    return nanos;
+}
+
+/*!
+ * \brief fillDebugInfo -- Add old rows to DebugInfo until it holds \a rows.
+ *
+ * Their times are long past, so ShowDiagnosticsSince has to skip them through the index.
+ */
+static bool fillDebugInfo(QSqlDatabase &db, qint64 rows)
+{
+    QSqlQuery query(db);
+    if (!query.exec("SELECT COUNT(*) FROM DebugInfo") || !query.next())
+        return false;
+    const qint64 have = query.value(0).toLongLong();
+    const QDateTime base(QDate(2000, 1, 1), QTime(0, 0));
+    db.transaction();
+    query.prepare("INSERT INTO DebugInfo (Time, Severity, ArchiveTag, FilePath, FunctionName, SourceLineNo, Message, LastTime)"
+                  " VALUES (?, 'Debug', ?, ?, 'void fill()', 1, ?, ?)");
+    for (qint64 i = have; i < rows; ++i)
+    {
+        const QString time = base.addMSecs(i).toString("yyyy-MM-dd HH:mm:ss.zzz");
+        query.addBindValue(time);
+        query.addBindValue(CommitTag);
+        query.addBindValue(QString(__FILE__));
+        query.addBindValue(QString("Old row %1").arg(i));
+        query.addBindValue(time);
+        if (!query.exec())
+        {
+            fprintf(stderr, "Unable to fill DebugInfo: %s\n", qPrintable(query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+    return db.commit();
+}
+
+/*!
+ * \brief printRow -- Write \a row to stdout as one line of JSON.
+ */
+static void printRow(const QJsonObject &row)
+{
+    fprintf(stdout, "%s\n", QJsonDocument(row).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+}
+
+/*!
+ * \brief threadCounts -- 1, 2, 4, ... up to \a most, and \a most itself.
+ */
+static QVector<int> threadCounts(int most)
+{
+    QVector<int> counts;
+    for (int threads = 1; threads < most; threads *= 2)
+        counts.append(threads);
+    counts.append(most);
+    return counts;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("diagbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure the cost of capturing, dumping and showing diagnostics.");
+    parser.addHelpOption();
+    QCommandLineOption messagesOption(QStringList() << "m" << "messages",
+                                      "Messages captured per round.", "count", "100000");
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+                                     "Most capturing threads.", "count", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption rowsOption(QStringList() << "r" << "rows",
+                                  "DebugInfo sizes for ShowDiagnosticsSince.", "list", "1000,10000,100000");
+    QCommandLineOption databaseOption(QStringList() << "d" << "database",
+                                      "SQLite file to use; it must not exist.", "path");
+    parser.addOption(messagesOption);
+    parser.addOption(threadsOption);
+    parser.addOption(rowsOption);
+    parser.addOption(databaseOption);
+    parser.process(app);
+    const int messages = qMax(1, parser.value(messagesOption).toInt());
+    const int mostThreads = qMax(1, parser.value(threadsOption).toInt());
+    QVector<qint64> sizes;
+    for (const QString &size : parser.value(rowsOption).split(',', Qt::SkipEmptyParts))
+        sizes.append(size.toLongLong());
+
+    QTemporaryDir scratch;
+    const QString path = parser.isSet(databaseOption) ? parser.value(databaseOption) : scratch.filePath("diagbench.sqlite");
+    if (!createDebugInfoTable(path))
+        return 2;
+
+    // Every round fits in the capture buffer, and is only dumped when timed.
+    DebugInfoCapacity = messages + 4096;
+    DebugInfoFlushThreshold = std::numeric_limits<int>::max();
+    AsyncDiagnosticsFlush = false;
+    DebugInfoPurgeIntervalMinutes = std::numeric_limits<int>::max() / 60000;
+    qInstallMessageHandler(saveMessageOutput);
+    if (addDebugConnection("QSQLITE", path, "", "", "", 0, "diagbench").type() != QSqlError::NoError)
+        return 2;
+    QSqlDatabase db = QSqlDatabase::database(DebugConnectionName);
+    captureMessages(saveMessageOutput, 1000, 1);       // Warm up the call-site cache and the arena.
+    DumpDebugInfo();
+
+    // Draining is the dump for the database and the terminal writer's flush for stderr.
+    const struct { const char *name; QtMessageHandler handler; } handlers[] = {
+        { "saveMessageOutput", saveMessageOutput },
+        { "terminalMessageOutput", terminalMessageOutput },
+        { "bothMessageOutput", bothMessageOutput }
+    };
+    for (const auto &handler : handlers)
+    {
+        for (int threads : threadCounts(mostThreads))
+        {
+            quint64 allocations = 0;
+            const qint64 captureNanos = captureMessages(handler.handler, messages, threads, &allocations);
+            const quint64 rowsBefore = DiagnosticsMetricsSnapshot().rowsInserted;
+            QElapsedTimer drainTimer;
+            drainTimer.start();
+            DumpDebugInfo();
+            FlushTerminalOutput();
+            const qint64 drainNanos = drainTimer.nsecsElapsed();
+            const quint64 rows = DiagnosticsMetricsSnapshot().rowsInserted - rowsBefore;
+            QJsonObject row;
+            row["benchmark"] = "capture";
+            row["handler"] = handler.name;
+            row["database"] = path;
+            row["threads"] = threads;
+            row["messages"] = messages;
+            row["nsPerMessage"] = double(captureNanos) / messages;
+            row["allocationsPerMessage"] = double(allocations) / messages;
+            row["messagesPerSecond"] = messages * 1e9 / double(captureNanos);
+            row["drainMs"] = drainNanos / 1e6;
+            row["rowsInserted"] = double(rows);
+            row["rowsPerSecond"] = drainNanos ? rows * 1e9 / double(drainNanos) : 0.0;
+            printRow(row);
+        }
+    }
+
+    QSqlQuery(db).exec("DELETE FROM DebugInfo");
+    for (qint64 size : sizes)
+    {
+        if (!fillDebugInfo(db, size))
+            return 1;
+        QThread::msleep(5);     // Keep the previous size's new rows before the mark.
+        const QDateTime mark = QDateTime::currentDateTime();
+        captureMessages(saveMessageOutput, 100, 1);
+        DumpDebugInfo();
+        const quint64 shownBefore = DiagnosticsMetricsSnapshot().queryRows;
+        QElapsedTimer showTimer;
+        showTimer.start();
+        ShowDiagnosticsSince(mark);
+        const qint64 showNanos = showTimer.nsecsElapsed();
+        FlushTerminalOutput();
+        QJsonObject row;
+        row["benchmark"] = "show";
+        row["tableRows"] = double(size + 100);
+        row["newRows"] = 100;
+        row["ms"] = showNanos / 1e6;
+        row["rowsShown"] = double(DiagnosticsMetricsSnapshot().queryRows - shownBefore);
+        printRow(row);
+    }
+
+    QJsonObject metrics;
+    metrics["benchmark"] = "metrics";
+    metrics["metrics"] = QJsonDocument::fromJson(DiagnosticsMetricsJson()).object();
+    printRow(metrics);
+    qInstallMessageHandler(nullptr);
+    return 0;
+}
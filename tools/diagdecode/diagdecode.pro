@@ -0,0 +1,12 @@
+# diagdecode.pro -- Print diagnostics files, or import them into DebugInfo.
+
+QT = core sql
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = diagdecode
+
+INCLUDEPATH += ../..
+HEADERS += ../../supportfunctions.h
+SOURCES += main.cpp ../../supportfunctions.cpp
+
+include(../../CommitTag.pri)